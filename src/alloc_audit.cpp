@@ -0,0 +1,66 @@
+#include "alloc_audit.hpp"
+
+#if ALLOC_AUDIT
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace alloc_audit {
+    thread_local u32 scope_depth = 0;
+    static thread_local u64 hot_path_allocations = 0;
+
+    u64 get_hot_path_allocations() {
+        return hot_path_allocations;
+    }
+
+    static void record(size_t size) {
+        if (scope_depth == 0) {
+            return;
+        }
+        ++hot_path_allocations;
+
+        #if ALLOC_AUDIT >= 2
+            std::fprintf(stderr, "alloc_audit: %zu byte heap allocation inside submit_message\n", size);
+            std::abort();
+        #endif
+    }
+}
+
+// Replacement global allocation functions, only linked in audit builds
+void* operator new(size_t size) {
+    alloc_audit::record(size);
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+    alloc_audit::record(size);
+    size_t alignment = static_cast<size_t>(align);
+    size_t rounded   = size ? (size + alignment - 1) / alignment * alignment : alignment;
+    if (void* ptr = std::aligned_alloc(alignment, rounded)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+#endif
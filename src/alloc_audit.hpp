@@ -0,0 +1,31 @@
+#pragma once
+
+#include "util.hpp"
+
+// Heap allocation audit for the message hot path.
+//   0 = off, AuditScope compiles away
+//   1 = count global allocations made while an AuditScope is live
+//   2 = abort on the first one
+#ifndef ALLOC_AUDIT
+#define ALLOC_AUDIT 0
+#endif
+
+namespace alloc_audit {
+
+#if ALLOC_AUDIT
+    extern thread_local u32 scope_depth;
+
+    struct AuditScope {
+        AuditScope()  { ++scope_depth; }
+        ~AuditScope() { --scope_depth; }
+    };
+
+    // Global allocations seen inside an AuditScope on this thread
+    u64 get_hot_path_allocations();
+#else
+    struct AuditScope {};
+
+    inline u64 get_hot_path_allocations() { return 0; }
+#endif
+
+}
@@ -0,0 +1,15 @@
+#include "arena.hpp"
+
+// Anything bigger than this skips the pools and comes straight off the
+// monotonic buffer, where it is never reclaimed. The pool carves a whole
+// chunk (~16 blocks) the first time a size class is used, so keep this small:
+// levels up to 8k orders are pooled, a growing order table's old bucket
+// arrays are left behind (at most as much again as the live one).
+static constexpr size_t LARGEST_POOL_BLOCK = 1ULL << 16;
+
+// The buffer is mapped (and prefaulted) before the pool is built,
+// the pool keeps its own bookkeeping in the buffer
+BookArena::BookArena(const BookConfig& config)
+    : buffer(config.arena_bytes, config.page_size, config.numa_local ? current_numa_node() : -1, config.prefault),
+      upstream(buffer.get_data(), buffer.get_size(), std::pmr::null_memory_resource()),
+      pool(std::pmr::pool_options{ .max_blocks_per_chunk = 0, .largest_required_pool_block = LARGEST_POOL_BLOCK }, &upstream) {}
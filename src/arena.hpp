@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory_resource>
+
+#include "util.hpp"
+#include "placement.hpp"
+
+// Sizing for everything a book allocates internally. The defaults keep an
+// idle book cheap: the arena is address space until pages are touched and
+// the order table grows on demand. Latency runs should size both up front
+// and prefault.
+struct BookConfig {
+    size_t arena_bytes = 16ULL << 20; // order table, levels and their order id lists
+    size_t max_orders  = 1ULL << 12;  // order table buckets are reserved for this many live orders
+    bool   prefault    = false;       // touch every arena page up front instead of on first use
+
+    PageSize page_size  = PageSize::SMALL; // falls back to smaller pages when the hugetlb pool is short
+    bool     numa_local = false;           // bind to the NUMA node of the constructing thread, pin it first
+};
+
+// Memory for one book, taken once at construction.
+//
+// Freed blocks go back to per-size pools and get reused, so steady-state
+// processing never reaches the global allocator. Running past arena_bytes
+// throws std::bad_alloc rather than silently falling back to the heap.
+class BookArena {
+public:
+    explicit BookArena(const BookConfig& config);
+
+    BookArena(const BookArena&) = delete;
+    BookArena& operator=(const BookArena&) = delete;
+
+    std::pmr::memory_resource* get_resource() { return &pool; }
+    size_t get_capacity() const { return buffer.get_size(); }
+    const PageBuffer& get_buffer() const { return buffer; }
+
+private:
+    PageBuffer buffer;
+    std::pmr::monotonic_buffer_resource upstream;
+    std::pmr::unsynchronized_pool_resource pool;
+};
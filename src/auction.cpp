@@ -0,0 +1,39 @@
+#include "auction.hpp"
+
+std::ostream& operator<<(std::ostream& os, const IndicativeCross& cross) {
+    os << "IndicativeCross(price=" << cross.price
+       << ", matched=" << cross.matched_shares
+       << ", imbalance=" << cross.imbalance_shares
+       << ", side=" << cross.imbalance_side
+       << ", valid=" << cross.valid
+       << ")";
+    return os;
+}
+
+Auction::Auction(std::pmr::memory_resource* resource)
+    : paired_shares(0), imbalance_shares(0), imbalance_direction('N'), reference_price(0.0f),
+      last_cross_price(0.0f), last_cross_shares(0),
+      cross{ .price = 0.0f, .matched_shares = 0, .imbalance_shares = 0, .imbalance_side = 'N', .valid = false },
+      dirty(true), ask_prices(resource), bid_prices(resource), price_scratch(resource), candidates(resource) {}
+
+void Auction::on_noii(const NOIIMessage& msg) {
+    paired_shares       = msg.paired_shares;
+    imbalance_shares    = msg.imbalance_shares;
+    imbalance_direction = static_cast<char>(msg.imbalance_direction);
+    reference_price     = msg.current_reference_price;
+
+    dirty = true;
+}
+
+void Auction::on_cross(const CrossTradeMessage& msg) {
+    last_cross_price  = msg.cross_price;
+    last_cross_shares = msg.shares;
+
+    // The auction is done, any further NOII starts a new one
+    paired_shares       = 0;
+    imbalance_shares    = 0;
+    imbalance_direction = 'N';
+    reference_price     = 0.0f;
+
+    dirty = true;
+}
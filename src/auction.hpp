@@ -0,0 +1,183 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <memory_resource>
+#include <cmath>
+#include <iterator>
+
+#include "util.hpp"
+
+// Result of pricing the opening/closing cross against the current book
+struct IndicativeCross {
+    f32  price;
+    u64  matched_shares;
+    u64  imbalance_shares;
+    char imbalance_side; // 'B', 'S' or 'N'
+    bool valid;
+
+    friend std::ostream& operator<<(std::ostream& os, const IndicativeCross& cross);
+};
+
+// Opening/closing cross simulator.
+//
+// Level sizes are kept up to date by the book itself (PriceLevel::total_quantity),
+// so repricing never touches individual orders. It only walks the levels that
+// can take part in the cross: the crossed region between best ask and best bid,
+// plus however far the NOII paired/imbalance interest reaches past it.
+class Auction {
+public:
+    explicit Auction(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    void on_noii(const NOIIMessage& msg);
+    void on_cross(const CrossTradeMessage& msg);
+
+    // Called by the book whenever a level changes
+    void invalidate() { dirty = true; }
+
+    template<typename BidLevels, typename AskLevels>
+    const IndicativeCross& reprice(const BidLevels& bids, const AskLevels& asks);
+
+    const IndicativeCross& get_cross() const { return cross; }
+    f32 get_last_cross_price() const { return last_cross_price; }
+    u64 get_last_cross_shares() const { return last_cross_shares; }
+
+private:
+    struct Candidate {
+        f32 price;
+        u64 buy_shares;  // buy interest willing to trade at price
+        u64 sell_shares; // sell interest willing to trade at price
+    };
+
+    // NOII state, paired and imbalance shares are treated as auction-only
+    // interest that will trade at any price
+    u64  paired_shares;
+    u64  imbalance_shares;
+    char imbalance_direction;
+    f32  reference_price;
+
+    f32 last_cross_price;
+    u64 last_cross_shares;
+
+    IndicativeCross cross;
+    bool dirty;
+
+    // scratch, reused between reprices
+    std::pmr::vector<f32> ask_prices;
+    std::pmr::vector<f32> bid_prices;
+    std::pmr::vector<f32> price_scratch;
+    std::pmr::vector<Candidate> candidates;
+};
+
+template<typename BidLevels, typename AskLevels>
+const IndicativeCross& Auction::reprice(const BidLevels& bids, const AskLevels& asks) {
+    if (!dirty) {
+        return cross;
+    }
+    dirty = false;
+
+    const u64 market_buy  = paired_shares + (imbalance_direction == 'B' ? imbalance_shares : 0);
+    const u64 market_sell = paired_shares + (imbalance_direction == 'S' ? imbalance_shares : 0);
+
+    const f32 best_bid = bids.empty() ? 0.0f : bids.begin()->first;
+    const f32 best_ask = asks.empty() ? 0.0f : asks.begin()->first;
+
+    ask_prices.clear();
+    bid_prices.clear();
+    candidates.clear();
+
+    // Ask prices above the best bid can only be hit by market buy interest,
+    // once the asks below cover it every further level just grows the imbalance
+    u64 cumulative = 0;
+    for (const auto& [price, level] : asks) {
+        if (price > best_bid && cumulative >= market_buy) {
+            break;
+        }
+        ask_prices.push_back(price);
+        cumulative += level.total_quantity;
+    }
+
+    cumulative = 0;
+    for (const auto& [price, level] : bids) {
+        if ((asks.empty() || price < best_ask) && cumulative >= market_sell) {
+            break;
+        }
+        bid_prices.push_back(price);
+        cumulative += level.total_quantity;
+    }
+
+    if (ask_prices.empty() && bid_prices.empty()) {
+        // Nothing on the book, only the NOII interest can pair off
+        u64 matched = std::min(market_buy, market_sell);
+        u64 buy = market_buy, sell = market_sell;
+        cross = IndicativeCross {
+            .price = reference_price,
+            .matched_shares = matched,
+            .imbalance_shares = buy > sell ? buy - sell : sell - buy,
+            .imbalance_side = buy > sell ? 'B' : (sell > buy ? 'S' : 'N'),
+            .valid = matched > 0
+        };
+        return cross;
+    }
+
+    // Both walks come out sorted, asks ascending and bids descending, so a merge is enough.
+    // Not std::inplace_merge, that takes a temporary buffer from the heap
+    std::set_union(ask_prices.begin(), ask_prices.end(), bid_prices.rbegin(), bid_prices.rend(),
+                   std::back_inserter(price_scratch));
+    for (f32 price : price_scratch) {
+        candidates.push_back({ price, 0, 0 });
+    }
+    price_scratch.clear();
+
+    // Sells willing to trade at p are asks priced at or below p
+    auto ask_it = asks.begin();
+    cumulative = market_sell;
+    for (auto& candidate : candidates) {
+        for (; ask_it != asks.end() && ask_it->first <= candidate.price; ++ask_it) {
+            cumulative += ask_it->second.total_quantity;
+        }
+        candidate.sell_shares = cumulative;
+    }
+
+    // Buys willing to trade at p are bids priced at or above p
+    auto bid_it = bids.begin();
+    cumulative = market_buy;
+    for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+        for (; bid_it != bids.end() && bid_it->first >= it->price; ++bid_it) {
+            cumulative += bid_it->second.total_quantity;
+        }
+        it->buy_shares = cumulative;
+    }
+
+    // Maximise matched volume, then minimise the leftover imbalance,
+    // then stay as close to the reference price as possible
+    const Candidate* best = nullptr;
+    u64 best_matched = 0, best_imbalance = 0;
+    for (const auto& candidate : candidates) {
+        u64 matched   = std::min(candidate.buy_shares, candidate.sell_shares);
+        u64 imbalance = std::max(candidate.buy_shares, candidate.sell_shares) - matched;
+
+        bool better = best == nullptr
+            || matched > best_matched
+            || (matched == best_matched && imbalance < best_imbalance)
+            || (matched == best_matched && imbalance == best_imbalance && reference_price > 0.0f
+                && std::fabs(candidate.price - reference_price) < std::fabs(best->price - reference_price));
+
+        if (better) {
+            best = &candidate;
+            best_matched = matched;
+            best_imbalance = imbalance;
+        }
+    }
+
+    cross = IndicativeCross {
+        .price = best->price,
+        .matched_shares = best_matched,
+        .imbalance_shares = best_imbalance,
+        .imbalance_side = best->buy_shares > best->sell_shares ? 'B' : (best->sell_shares > best->buy_shares ? 'S' : 'N'),
+        .valid = best_matched > 0
+    };
+
+    return cross;
+}
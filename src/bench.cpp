@@ -1,28 +1,375 @@
 #include "orderbook.hpp"
+#include "replay.hpp"
 #include <random>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <memory>
+#include <filesystem>
+#include <thread>
+
+// Book sized and prefaulted up front, for runs that measure latency
+static constexpr BookConfig LATENCY_BOOK = {
+    .arena_bytes = 64ULL << 20, .max_orders = 1ULL << 18, .prefault = true
+};
 
 const void benchmark_orderbook() {
-    auto ob = OrderBook("TSLA");
-    
+    auto ob = OrderBook("TSLA", 0.01, LATENCY_BOOK);
+
     // pseudo-random-number gen
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_real_distribution<double> price_dist(0.01, 1000.0);
     std::uniform_int_distribution<int> quantity_dist(1, 10000);
     std::uniform_int_distribution<int> side_dist(0, 1);
-    
+
     const int num_orders = 100'000;
-    
+
     for(int i = 0; i < num_orders; i++) {
         double price = price_dist(gen);
         int quantity = quantity_dist(gen);
         char side = side_dist(gen) ? 'B' : 'S';
-        
+
         ob.add_order(price, quantity, side);
     }
 }
 
-int main() {
+// Reprices every book in a closing-cross sized universe on each NOII round,
+// with a few orders landing between rounds like they do into the close
+const void benchmark_closing_cross() {
+    const int num_symbols       = 8'000;
+    const int orders_per_symbol = 500;
+    const int noii_rounds       = 30; // NOII goes out every 10s for the last 5min
+    const int orders_per_round  = 5;
+
+    std::mt19937 gen(42);
+    std::normal_distribution<double> offset_dist(0.0, 0.5);
+    std::uniform_int_distribution<int> quantity_dist(1, 1000);
+    std::uniform_int_distribution<int> side_dist(0, 1);
+    std::uniform_int_distribution<int> cross_dist(0, 9);
+    std::uniform_int_distribution<u64> imbalance_dist(0, 5'000);
+
+    std::vector<OrderBook> books;
+    books.reserve(num_symbols);
+
+    auto random_order = [&](OrderBook& ob, f32 mid) {
+        char side = side_dist(gen) ? 'B' : 'S';
+        // most interest rests on its own side of the mid, on-close orders cross it by a few ticks
+        f32 offset = std::fabs(static_cast<f32>(static_cast<int>(offset_dist(gen) * 100)) / 100) + 0.01f;
+        bool crossing = cross_dist(gen) == 0;
+        if (crossing) {
+            offset = 0.01f * (1 + cross_dist(gen) % 5);
+        }
+        f32 price = ((side == 'B') != crossing) ? mid - offset : mid + offset;
+        ob.add_order(price, quantity_dist(gen), side);
+    };
+
+    for (int s = 0; s < num_symbols; s++) {
+        // small arenas, left to fault in lazily so the whole universe fits in memory
+        auto& ob = books.emplace_back("SYM" + std::to_string(s), 0.01, BookConfig {
+            .arena_bytes = 512 << 10, .max_orders = 1024, .prefault = false
+        });
+        for (int i = 0; i < orders_per_symbol; i++) {
+            random_order(ob, 100.0f);
+        }
+    }
+
+    NOIIMessage noii = {
+        .header = { .message_type = 'I', .stock_locate = 0, .tracking_number = 0, .timestamp = 0 },
+        .paired_shares = 0,
+        .imbalance_shares = 0,
+        .imbalance_direction = 'B',
+        .stock = {},
+        .far_price = 0.0,
+        .near_price = 0.0,
+        .current_reference_price = 100.0,
+        .cross_type = 'C',
+        .price_variation_indicator = ' '
+    };
+
+    std::chrono::nanoseconds reprice_time{0};
+    u64 matched = 0;
+
+    for (int round = 0; round < noii_rounds; round++) {
+        for (auto& ob : books) {
+            for (int i = 0; i < orders_per_round; i++) {
+                random_order(ob, 100.0f);
+            }
+
+            noii.paired_shares = imbalance_dist(gen);
+            noii.imbalance_shares = imbalance_dist(gen);
+            noii.imbalance_direction = side_dist(gen) ? 'B' : 'S';
+
+            auto start = std::chrono::steady_clock::now();
+            ob.submit_message(noii);
+            reprice_time += std::chrono::steady_clock::now() - start;
+
+            matched += ob.get_indicative_cross().matched_shares;
+        }
+    }
+
+    const u64 num_messages = static_cast<u64>(num_symbols) * noii_rounds;
+    std::cout << "closing cross: " << num_symbols << " symbols, " << num_messages << " NOII messages, "
+              << reprice_time.count() / num_messages << " ns/reprice"
+              << " (matched " << matched << ")" << std::endl;
+}
+
+// Generates an ITCH stream for one symbol where both sides arrive interleaved
+// at random, so nothing about the side of the next message is predictable
+template<typename Messages>
+static void generate_mixed_messages(Messages& messages, size_t num_messages, u64 message_gap_ns,
+                                    u16 stock_locate = 0, u32 seed = 7) {
+    const size_t max_live = 20'000;
+
+    std::mt19937 gen(seed);
+    std::normal_distribution<double> offset_dist(0.0, 0.5);
+    std::uniform_int_distribution<int> quantity_dist(1, 1000);
+    std::uniform_int_distribution<int> side_dist(0, 1);
+    std::uniform_int_distribution<int> action_dist(0, 9);
+
+    struct Live { u64 id; u32 shares; };
+    std::vector<Live> live;
+    u64 next_id = 1;
+
+    auto random_price = [&](bool buy) {
+        f32 offset = std::fabs(static_cast<f32>(static_cast<int>(offset_dist(gen) * 100)) / 100) + 0.01f;
+        return buy ? 100.0f - offset : 100.0f + offset;
+    };
+
+    const MessageHeader header = { .message_type = 0, .stock_locate = 0, .tracking_number = 0, .timestamp = 0 };
+
+    while (messages.size() < num_messages) {
+        int action = action_dist(gen);
+
+        if (live.size() < max_live / 2 || (action < 5 && live.size() < max_live)) {
+            bool buy = side_dist(gen);
+            u32 shares = quantity_dist(gen);
+            messages.emplace_back(AddOrderNoMPIDMessage {
+                .header = header, .order_reference_number = next_id,
+                .buy_sell_indicator = static_cast<std::byte>(buy ? 'B' : 'S'),
+                .shares = shares, .stock = "TSLA", .price = random_price(buy)
+            });
+            live.push_back({ next_id++, shares });
+            continue;
+        }
+
+        size_t index = std::uniform_int_distribution<size_t>(0, live.size() - 1)(gen);
+        Live& order = live[index];
+
+        if (action < 7) {
+            u32 shares = std::uniform_int_distribution<u32>(1, order.shares)(gen);
+            messages.emplace_back(OrderExecutedMessage {
+                .header = header, .order_reference_number = order.id, .executed_shares = shares, .match_number = 0
+            });
+            order.shares -= shares;
+        } else if (action < 8) {
+            u32 shares = std::uniform_int_distribution<u32>(1, order.shares)(gen);
+            messages.emplace_back(OrderCancelMessage {
+                .header = header, .order_reference_number = order.id, .cancelled_shares = shares
+            });
+            order.shares -= shares;
+        } else if (action < 9) {
+            u32 shares = quantity_dist(gen);
+            // side is kept on replace, so only the price magnitude is random here
+            messages.emplace_back(OrderReplaceMessage {
+                .header = header, .original_order_reference_number = order.id,
+                .new_order_reference_number = next_id, .shares = shares, .price = 0.0f
+            });
+            order = { next_id++, shares };
+        } else {
+            messages.emplace_back(OrderDeleteMessage { .header = header, .order_reference_number = order.id });
+            order.shares = 0;
+        }
+
+        if (order.shares == 0) {
+            order = live.back();
+            live.pop_back();
+        }
+    }
+
+    // replace prices need the side of the order, so fill them in against a shadow book
+    std::unordered_map<u64, bool> is_buy;
+    u64 timestamp = 0;
+    for (auto& message : messages) {
+        timestamp += message_gap_ns;
+        std::visit(overloaded {
+            [](std::monostate&) {},
+            [&](auto& msg) {
+                msg.header.message_type = get_message_code<std::decay_t<decltype(msg)>>();
+                msg.header.timestamp = timestamp;
+                msg.header.stock_locate = stock_locate;
+            }
+        }, message);
+
+        if (auto* add = std::get_if<AddOrderNoMPIDMessage>(&message)) {
+            is_buy[add->order_reference_number] = add->buy_sell_indicator == static_cast<std::byte>('B');
+        } else if (auto* replace = std::get_if<OrderReplaceMessage>(&message)) {
+            bool buy = is_buy[replace->original_order_reference_number];
+            replace->price = random_price(buy);
+            is_buy[replace->new_order_reference_number] = buy;
+        }
+    }
+}
+
+// Replays the mixed stream through one book
+const void benchmark_mixed_replay(const BookConfig& config = LATENCY_BOOK) {
+    const size_t num_messages = 2'000'000;
+
+    // the message ring gets the same page backing and node as the book
+    PageBuffer ring(num_messages * sizeof(OrderMessage), config.page_size,
+                    config.numa_local ? current_numa_node() : -1, config.prefault);
+    std::pmr::monotonic_buffer_resource ring_resource(ring.get_data(), ring.get_size(), std::pmr::null_memory_resource());
+
+    std::pmr::vector<OrderMessage> messages(&ring_resource);
+    messages.reserve(num_messages);
+    generate_mixed_messages(messages, num_messages, 1'000);
+
+    auto ob = OrderBook("TSLA", 0.01, config);
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& message : messages) {
+        ob.submit_message(message);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    std::cout << "mixed replay (" << page_size_name(ring.get_page_size()) << " pages"
+              << (ring.is_thp_advised() ? " + THP" : "")
+              << (ring.is_numa_bound() ? ", numa bound" : "") << "): " << messages.size() << " messages, "
+              << elapsed.count() / messages.size() << " ns/msg";
+    #if ALLOC_AUDIT
+        std::cout << ", " << alloc_audit::get_hot_path_allocations() << " hot path allocations";
+    #endif
+    std::cout << std::endl;
+}
+
+// Same stream with a snapshot sink attached, then reads the file back through mmap
+const void benchmark_snapshot_export(const std::string& path) {
+    const size_t num_messages = 2'000'000;
+
+    std::vector<OrderMessage> messages;
+    messages.reserve(num_messages);
+    generate_mixed_messages(messages, num_messages, 20'000); // 40s of feed, 400 samples
+
+    std::chrono::nanoseconds elapsed[2];
+    u64 dropped = 0;
+
+    for (int with_sink = 0; with_sink < 2; with_sink++) {
+        auto ob = OrderBook("TSLA", 0.01, LATENCY_BOOK);
+        std::unique_ptr<SnapshotSink> sink;
+        if (with_sink) {
+            sink = std::make_unique<SnapshotSink>(SnapshotConfig { .path = path });
+            ob.attach_snapshot_sink(sink.get(), 1);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& message : messages) {
+            ob.submit_message(message);
+        }
+        elapsed[with_sink] = std::chrono::steady_clock::now() - start;
+
+        if (sink) {
+            sink->close();
+            dropped = sink->get_dropped_rows();
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    SnapshotReader reader(path);
+    u64 rows = 0;
+    f64 spread_sum = 0;
+    for (const auto& block : reader.get_blocks()) {
+        for (u32 row = 0; row < block.rows(); row++) {
+            spread_sum += block.ask_price(0, row) - block.bid_price(0, row);
+        }
+        rows += block.rows();
+    }
+    auto read_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    std::cout << "snapshot export: " << num_messages << " messages, "
+              << elapsed[0].count() / num_messages << " ns/msg without sink, "
+              << elapsed[1].count() / num_messages << " ns/msg with sink, "
+              << rows << " rows (" << dropped << " dropped), read back in "
+              << read_elapsed.count() / 1'000'000 << "ms"
+              << " (mean spread " << spread_sum / rows << ")" << std::endl;
+}
+
+// Writes num_files synthetic day files of interleaved symbols, then replays them all
+// at doubling thread counts to show how the driver scales
+const void benchmark_parallel_replay() {
+    const u32 num_files       = 8;
+    const u32 symbols_per_day = 8;
+    const size_t messages_per_symbol = 100'000;
+
+    const auto dir = std::filesystem::temp_directory_path() / "ob_replay_bench";
+    std::filesystem::create_directories(dir);
+
+    ReplayConfig config;
+    config.output_dir = (dir / "out").string();
+    config.partitions_per_file = 2;
+
+    for (u32 day = 0; day < num_files; day++) {
+        // one stream per symbol, interleaved message by message like a real feed
+        std::vector<std::vector<OrderMessage>> streams(symbols_per_day);
+        for (u32 symbol = 0; symbol < symbols_per_day; symbol++) {
+            streams[symbol].reserve(messages_per_symbol);
+            generate_mixed_messages(streams[symbol], messages_per_symbol, 1'000, symbol + 1, day * 100 + symbol);
+        }
+
+        const auto path = dir / ("day" + std::to_string(day) + ".itch");
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        for (size_t i = 0; i < messages_per_symbol; i++) {
+            for (const auto& stream : streams) {
+                std::visit(overloaded {
+                    [](const std::monostate) {},
+                    [&](const auto& msg) { std::fwrite(&msg, sizeof(msg), 1, file); }
+                }, stream[i]);
+            }
+        }
+        std::fclose(file);
+
+        config.files.push_back(path.string());
+    }
+
+    const u32 hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    f64 single_thread_wall = 0;
+
+    for (u32 threads = 1; threads <= hardware_threads; threads *= 2) {
+        config.threads = threads;
+        ReplayReport report = run_replay(config);
+        if (threads == 1) {
+            single_thread_wall = report.wall_seconds;
+        }
+
+        std::cout << "parallel replay: " << num_files << " files, " << threads << " threads, "
+                  << report.wall_seconds << "s wall, " << single_thread_wall / report.wall_seconds << "x vs 1 thread"
+                  << (report.ok() ? "" : ", FAILED TASKS") << std::endl;
+
+        if (threads * 2 > hardware_threads) {
+            report.print(std::cout);
+        }
+    }
+
+    std::filesystem::remove_all(dir);
+}
+
+// usage: ob_bench [cpu], pins the benchmark thread when a cpu is given
+int main(int argc, char** argv) {
+    bool pinned = false;
+    if (argc > 1) {
+        int cpu = std::stoi(argv[1]);
+        pinned = pin_current_thread(cpu);
+        std::cout << (pinned ? "pinned to cpu " : "failed to pin to cpu ") << cpu
+                  << ", numa node " << current_numa_node() << std::endl;
+    }
+
     benchmark_orderbook();
+    benchmark_mixed_replay();
+    benchmark_mixed_replay(BookConfig {
+        .arena_bytes = LATENCY_BOOK.arena_bytes, .max_orders = LATENCY_BOOK.max_orders, .prefault = true,
+        .page_size = PageSize::HUGE_2MB, .numa_local = pinned
+    });
+    benchmark_closing_cross();
+    benchmark_snapshot_export("bench_snapshots.obs");
+    benchmark_parallel_replay();
     return 0;
 }
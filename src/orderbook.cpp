@@ -1,12 +1,15 @@
-// #include <stdexcept>
+#include <stdexcept>
 
 #include "util.hpp"
 #include "orderbook.hpp"
 
-constexpr static std::byte BUY_BYTE = static_cast<std::byte>('B');
-
 #define DEBUG 0
 
+// Rejects are thrown as copies of these. Copying shares the message, so a
+// rejected message never allocates inside submit_message's audit scope
+static const std::out_of_range UNKNOWN_ORDER_ID("OrderBook unknown order id");
+static const std::runtime_error SYMBOL_MISMATCH("AddOrderNoMPIDMessage/AddOrderWithMPIDMessage Stock/Symbol failed to match OrderBook Symbol field");
+
 std::ostream& operator<<(std::ostream& os, const Order& ord) {
     os << "Order(id=" << ord.order_reference_id
        << ", side=" << static_cast<char>(ord.side)
@@ -19,23 +22,42 @@ std::ostream& operator<<(std::ostream& os, const Order& ord) {
     return os;
 }
 
-OrderBook::OrderBook() : last_order_id(0) {} 
+OrderBook::OrderBook() : OrderBook("") {} 
 
-OrderBook::OrderBook(const std::string& sym, f32 ts)
-    : tick_size(ts), last_order_id(0) {
+OrderBook::OrderBook(const std::string& sym, f32 ts, const BookConfig& config)
+    : arena(std::make_unique<BookArena>(config)),
+      order_id_map(arena->get_resource()),
+      bids(arena->get_resource()),
+      asks(arena->get_resource()),
+      auction(arena->get_resource()),
+      snapshot_sink(nullptr), snapshot_locate(0), next_sample_ns(0), last_bbo{},
+      last_order_id(0), tick_size(ts) {
     symbol = sym;
+    order_id_map.reserve(config.max_orders);
 }
 
 OrderBook::~OrderBook() = default;
 
 void OrderBook::submit_message(const OrderMessage& msg) {
+    [[maybe_unused]] alloc_audit::AuditScope audit;
+
+    const u64 timestamp = snapshot_sink ? std::visit(overloaded {
+        [](const std::monostate) -> u64 { return 0; },
+        [](const auto& msg) -> u64 { return msg.header.timestamp; }
+    }, msg) : 0;
+
+    // samples show the book as it stood at the boundary, so take them before applying msg
+    if (timestamp) {
+        sample_snapshots(timestamp);
+    }
+
     std::visit(overloaded {
         [this](const auto& msg) requires (
             std::same_as<std::decay_t<decltype(msg)>, AddOrderWithMPIDMessage> || // for now ignore MPID
             std::same_as<std::decay_t<decltype(msg)>, AddOrderNoMPIDMessage>
         ) {
-            if(msg.stock != get_symbol()) {
-                throw std::runtime_error("AddOrderNoMPIDMessage/AddOrderWithMPIDMessage Stock/Symbol failed to match OrderBook Symbol field");
+            if(stock_view(msg.stock) != symbol) {
+                throw SYMBOL_MISMATCH;
             }
 
             u64 id = msg.order_reference_number;
@@ -80,9 +102,15 @@ void OrderBook::submit_message(const OrderMessage& msg) {
         [this] (const StockDirectoryMessage& msg) {}, // just metadata
         [this] (const StockTradingActionMessage& msg) {},
         [this] (const SystemEventMessage& msg) {},
-        [this] (const CrossTradeMessage& msg) {},               
+        [this] (const CrossTradeMessage& msg) {
+            auction.on_cross(msg);
+        },
         [this] (const BrokenTradeMessage& msg) {},
-        [this] (const NOIIMessage& msg) {},
+        // Reprice the cross on every imbalance update
+        [this] (const NOIIMessage& msg) {
+            auction.on_noii(msg);
+            auction.reprice(bids.get_levels(), asks.get_levels());
+        },
         [this] (const DirectListingWithCapitalRaisePriceMessage& msg) {},
         [this] (const MarketParticipantPositionMessage& msg) {},
         [this] (const ShortSalePriceTestMessage& msg) {},
@@ -95,6 +123,10 @@ void OrderBook::submit_message(const OrderMessage& msg) {
         [this] (const std::monostate) {} // default
     }, msg);
 
+    if (timestamp) {
+        snapshot_on_bbo_change(timestamp);
+    }
+
     #if DEBUG
         print();
     #endif
@@ -130,80 +162,111 @@ void OrderBook::add_order_to_book(const Order& order) {
         return;
     }
 
-    order_id_map[order.order_reference_id] = order;
-    
-    if (order.side == BUY_BYTE) {
-        bids[order.price].emplace_back(order.order_reference_id);
-    } else {
-        asks[order.price].emplace_back(order.order_reference_id);
-    }
+    // level first, an order in the map must always be on a level
+    with_side(order.side, [&](auto& book) {
+        book.add(order.order_reference_id, order.price, order.quantity);
+        try {
+            order_id_map[order.order_reference_id] = order;
+        } catch (...) {
+            book.remove(order.order_reference_id, order.price, order.quantity);
+            throw;
+        }
+    });
+
+    auction.invalidate();
 }
 
 
 Order& OrderBook::get_order_from_id(u64 order_id) {
-    return order_id_map.at(order_id);
+    auto it = order_id_map.find(order_id);
+    if (it == order_id_map.end()) {
+        throw UNKNOWN_ORDER_ID;
+    }
+    return it->second;
+}
+
+const Order* OrderBook::find_order(u64 order_id) const {
+    auto it = order_id_map.find(order_id);
+    return it == order_id_map.end() ? nullptr : &it->second;
 }
 
 Order OrderBook::remove_order_from_id(u64 order_id) {
-    Order& order = get_order_from_id(order_id);
-    auto& level = (order.side == BUY_BYTE) ? bids[order.price] : asks[order.price];
-    level.erase(std::find(level.begin(), level.end(), order_id));
-    
-    if (level.empty()) {
-        if (order.side == BUY_BYTE) {
-            bids.erase(order.price);
-        } else {
-            asks.erase(order.price);
-        }
-    }
-    
+    Order order = get_order_from_id(order_id);
+
+    with_side(order.side, [&](auto& book) {
+        book.remove(order_id, order.price, order.quantity);
+    });
+
     order_id_map.erase(order_id);
+    auction.invalidate();
     
     return order;
 }
 
-void OrderBook::cancel_order(u64 order_id, u32 cancelled_shares) {
-    Order& order = get_order_from_id(order_id);
-    order.quantity -= cancelled_shares;
+void OrderBook::reduce_order(Order& order, u32 shares) {
+    if (shares >= order.quantity) {
+        remove_order_from_id(order.order_reference_id);
+        return;
+    }
+
+    with_side(order.side, [&](auto& book) {
+        book.reduce(order.price, shares);
+    });
+    order.quantity -= shares;
+
+    auction.invalidate();
+}
 
-    if (order.quantity == 0) {
-        remove_order_from_id(order_id);
-    }       
+void OrderBook::cancel_order(u64 order_id, u32 cancelled_shares) {
+    reduce_order(get_order_from_id(order_id), cancelled_shares);
 }   
 
 void OrderBook::execute_order(u64 order_id, u32 executed_shares, u64 match_number) {
-    Order& order = get_order_from_id(order_id);
-    order.quantity -= executed_shares;
-
-    if (order.quantity == 0) {
-        remove_order_from_id(order_id);
-    }
+    reduce_order(get_order_from_id(order_id), executed_shares);
 }
 
 void OrderBook::replace_order(u64 original_order_id, u64 new_order_id, u32 shares, f32 price) {
-    Order new_order = get_order_from_id(original_order_id); // take most of the original orders data
+    const Order original = get_order_from_id(original_order_id);
 
+    Order new_order = original; // take most of the original orders data
     new_order.order_reference_id = new_order_id;
     new_order.price = price;
-        
-    remove_order_from_id(original_order_id);
+    new_order.quantity = shares;
+
+    // replace keeps the side, so both level updates go through one dispatch.
+    // The new order goes in before the original comes out, so if the arena
+    // runs out the book is left holding just the original
+    with_side(new_order.side, [&](auto& book) {
+        book.add(new_order_id, price, shares);
+        try {
+            order_id_map[new_order_id] = new_order;
+        } catch (...) {
+            book.remove(new_order_id, price, shares);
+            throw;
+        }
+        book.remove(original_order_id, original.price, original.quantity);
+    });
+
+    if (new_order_id != original_order_id) {
+        order_id_map.erase(original_order_id);
+    }
 
-    add_order_to_book(new_order);
+    auction.invalidate();
 }
 
 void OrderBook::print() const {
     std::cout << "--- BIDS ---" << std::endl;
-    for (const auto& [price, order_ids] : bids) {
-        std::cout << "Price " << price << ":" << std::endl;
-        for (u64 order_id : order_ids) {
+    for (const auto& [price, level] : bids.get_levels()) {
+        std::cout << "Price " << price << " (" << level.total_quantity << "):" << std::endl;
+        for (u64 order_id : level.order_ids) {
             std::cout << "  " << order_id_map.at(order_id) << std::endl;
         }
     }
 
     std::cout << "--- ASKS ---" << std::endl;
-    for (const auto& [price, order_ids] : asks) {
-        std::cout << "Price " << price << ":" << std::endl;
-        for (u64 order_id : order_ids) {
+    for (const auto& [price, level] : asks.get_levels()) {
+        std::cout << "Price " << price << " (" << level.total_quantity << "):" << std::endl;
+        for (u64 order_id : level.order_ids) {
             std::cout << "  " << order_id_map.at(order_id) << std::endl;
         }
     }
@@ -211,11 +274,11 @@ void OrderBook::print() const {
 }
 
 f32 OrderBook::get_best_bid() {
-    return bids.empty() ? 0.0 : bids.begin()->first;
+    return bids.best();
 }
 
 f32 OrderBook::get_best_ask() {
-    return asks.empty() ? 0.0 : asks.begin()->first;
+    return asks.best();
 }
 
 const std::string OrderBook::get_symbol() const {
@@ -225,3 +288,72 @@ const std::string OrderBook::get_symbol() const {
 f32 OrderBook::get_tick_size() const {
     return tick_size;
 }
+
+const IndicativeCross& OrderBook::get_indicative_cross() {
+    return auction.reprice(bids.get_levels(), asks.get_levels());
+}
+
+void OrderBook::attach_snapshot_sink(SnapshotSink* sink, u16 stock_locate) {
+    snapshot_sink = sink;
+    snapshot_locate = stock_locate;
+    next_sample_ns = 0;
+    last_bbo = get_bbo();
+}
+
+void OrderBook::flush_snapshots(u64 end_timestamp) {
+    // a book that never saw a message has no grid to fill in
+    if (snapshot_sink && next_sample_ns != 0) {
+        sample_snapshots(end_timestamp);
+    }
+}
+
+OrderBook::BBO OrderBook::get_bbo() const {
+    return BBO {
+        .bid_price = bids.best(),
+        .ask_price = asks.best(),
+        .bid_quantity = bids.best_quantity(),
+        .ask_quantity = asks.best_quantity()
+    };
+}
+
+void OrderBook::sample_snapshots(u64 timestamp) {
+    const u64 interval = snapshot_sink->get_config().sample_interval;
+    if (interval == 0) {
+        return;
+    }
+
+    // first message only sets the grid, nothing is known about the book before it
+    if (next_sample_ns == 0) {
+        next_sample_ns = (timestamp / interval + 1) * interval;
+        return;
+    }
+
+    // quiet stretches still get one row per boundary
+    while (timestamp >= next_sample_ns) {
+        record_snapshot(next_sample_ns, SnapshotReason::SAMPLE);
+        next_sample_ns += interval;
+    }
+}
+
+void OrderBook::snapshot_on_bbo_change(u64 timestamp) {
+    if (!snapshot_sink->get_config().sample_on_bbo) {
+        return;
+    }
+
+    BBO bbo = get_bbo();
+    if (bbo != last_bbo) {
+        last_bbo = bbo;
+        record_snapshot(timestamp, SnapshotReason::BBO);
+    }
+}
+
+void OrderBook::record_snapshot(u64 timestamp, SnapshotReason reason) {
+    f32 bid_prices[SNAPSHOT_MAX_DEPTH], ask_prices[SNAPSHOT_MAX_DEPTH];
+    u32 bid_sizes[SNAPSHOT_MAX_DEPTH], ask_sizes[SNAPSHOT_MAX_DEPTH];
+
+    const u32 depth = snapshot_sink->get_config().depth;
+    bids.copy_depth(depth, bid_prices, bid_sizes);
+    asks.copy_depth(depth, ask_prices, ask_sizes);
+
+    snapshot_sink->append(timestamp, snapshot_locate, reason, bid_prices, bid_sizes, ask_prices, ask_sizes);
+}
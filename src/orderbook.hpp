@@ -2,14 +2,21 @@
 
 // #include <map>
 #include <unordered_map>
+#include <memory_resource>
 #include <variant>
 #include <iostream>
 #include <cstring>
 #include <string>
+#include <algorithm>
+#include <type_traits>
 // #include <vector>
 #include "absl/container/btree_map.h"
 
 #include "util.hpp"
+#include "auction.hpp"
+#include "arena.hpp"
+#include "alloc_audit.hpp"
+#include "snapshot.hpp"
 
 struct Order {
     u64 order_reference_id;
@@ -26,6 +33,92 @@ struct Order {
     friend std::ostream& operator<<(std::ostream& os, const Order& ord);
 };
 
+struct PriceLevel {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    u64 total_quantity = 0; // kept in sync with the orders so level size never needs a walk
+    std::pmr::vector<u64> order_ids;
+
+    // Allocator-aware so levels created inside the btree draw from the book arena
+    PriceLevel() = default;
+    explicit PriceLevel(const allocator_type& alloc) : order_ids(alloc) {}
+    PriceLevel(const PriceLevel& other, const allocator_type& alloc)
+        : total_quantity(other.total_quantity), order_ids(other.order_ids, alloc) {}
+    PriceLevel(PriceLevel&& other, const allocator_type& alloc)
+        : total_quantity(other.total_quantity), order_ids(std::move(other.order_ids), alloc) {}
+
+    PriceLevel(const PriceLevel&) = default;
+    PriceLevel(PriceLevel&&) = default;
+    PriceLevel& operator=(const PriceLevel&) = default;
+    PriceLevel& operator=(PriceLevel&&) = default;
+};
+
+// One side of the book. Everything that differs between bids and asks
+// (level ordering, which price is more aggressive) is resolved from Side
+// at compile time, so the level operations carry no side checks.
+template<OrderSide Side>
+class BookSide {
+public:
+    using Compare = std::conditional_t<Side == OrderSide::BUY, std::greater<f32>, std::less<f32>>;
+    using Levels  = absl::btree_map<f32, PriceLevel, Compare,
+                                    std::pmr::polymorphic_allocator<std::pair<const f32, PriceLevel>>>;
+
+    static constexpr std::byte side_byte = static_cast<std::byte>(Side == OrderSide::BUY ? 'B' : 'S');
+
+    explicit BookSide(std::pmr::memory_resource* resource) : levels(resource) {}
+
+    // Either the order lands on its level or, if the arena runs out, nothing changes
+    void add(u64 order_id, f32 price, u32 quantity) {
+        auto [it, inserted] = levels.try_emplace(price);
+        try {
+            it->second.order_ids.emplace_back(order_id);
+        } catch (...) {
+            if (inserted) {
+                levels.erase(it);
+            }
+            throw;
+        }
+        it->second.total_quantity += quantity;
+    }
+
+    void remove(u64 order_id, f32 price, u32 quantity) {
+        auto it = levels.find(price);
+        auto& level = it->second;
+        level.order_ids.erase(std::find(level.order_ids.begin(), level.order_ids.end(), order_id));
+        level.total_quantity -= quantity;
+
+        if (level.order_ids.empty()) {
+            levels.erase(it);
+        }
+    }
+
+    void reduce(f32 price, u32 quantity) {
+        levels.find(price)->second.total_quantity -= quantity;
+    }
+
+    f32 best() const { return levels.empty() ? 0.0 : levels.begin()->first; }
+    u64 best_quantity() const { return levels.empty() ? 0 : levels.begin()->second.total_quantity; }
+
+    // Top depth levels best first, missing levels come out as 0
+    void copy_depth(u32 depth, f32* prices, u32* sizes) const {
+        u32 level = 0;
+        for (auto it = levels.begin(); it != levels.end() && level < depth; ++it, ++level) {
+            prices[level] = it->first;
+            sizes[level]  = static_cast<u32>(it->second.total_quantity);
+        }
+        for (; level < depth; ++level) {
+            prices[level] = 0.0f;
+            sizes[level]  = 0;
+        }
+    }
+    bool empty() const { return levels.empty(); }
+
+    const Levels& get_levels() const { return levels; }
+
+private:
+    Levels levels;
+};
+
 using OrderMessage = std::variant<
     std::monostate,
     AddOrderNoMPIDMessage,
@@ -55,7 +148,9 @@ using OrderMessage = std::variant<
 class OrderBook {
 public:
     OrderBook();
-    OrderBook(const std::string& sym, f32 ts = 0.01);
+    OrderBook(const std::string& sym, f32 ts = 0.01, const BookConfig& config = {});
+
+    OrderBook(OrderBook&&) = default;
 
     ~OrderBook();
 
@@ -68,24 +163,64 @@ public:
     f32 get_best_ask();
     f32 get_tick_size() const;
 
+    const IndicativeCross& get_indicative_cross();
+
+    // Periodic and BBO-change depth snapshots go to sink, keyed by stock_locate.
+    // The sink must outlive the book or be detached with nullptr.
+    void attach_snapshot_sink(SnapshotSink* sink, u16 stock_locate);
+
+    // Samples are only taken when a message arrives, so a book that goes quiet
+    // stops sampling. Call at the end of the session to write every remaining
+    // boundary up to end_timestamp.
+    void flush_snapshots(u64 end_timestamp);
+
+    const Order* find_order(u64 order_id) const;
+
     void print() const;
     const std::string get_symbol() const;
 
 private:
-    std::unordered_map<u64, Order> order_id_map;
-    absl::btree_map<f32, std::vector<u64>, std::greater<f32>> bids;
-    absl::btree_map<f32, std::vector<u64>> asks;
-    
+    std::unique_ptr<BookArena> arena; // heap owned so its address survives moving the book
+    std::pmr::unordered_map<u64, Order> order_id_map;
+    BookSide<OrderSide::BUY>  bids;
+    BookSide<OrderSide::SELL> asks;
+
+    Auction auction;
+
+    struct BBO {
+        f32 bid_price, ask_price;
+        u64 bid_quantity, ask_quantity;
+
+        bool operator==(const BBO&) const = default;
+    };
+
+    SnapshotSink* snapshot_sink;
+    u16 snapshot_locate;
+    u64 next_sample_ns;
+    BBO last_bbo;
+
     u64 last_order_id; // Only used when add order is called without id param   
     std::string symbol;
     f32 tick_size;
 
+    // Resolves the side once per message, f gets the matching BookSide
+    template<typename F>
+    decltype(auto) with_side(std::byte side, F&& f) {
+        return (side == BookSide<OrderSide::BUY>::side_byte) ? f(bids) : f(asks);
+    }
+
     Order& get_order_from_id(u64 order_id);
     Order remove_order_from_id(u64 order_id);
+    void reduce_order(Order& order, u32 shares);
     void cancel_order(u64 order_id, u32 cancelled_shares);
     void execute_order(u64 order_id, u32 executed_shares, u64 match_order_id);
 
     void replace_order(u64 original_order_id, u64 new_order_id, u32 shares, f32 price);
+
+    BBO get_bbo() const;
+    void sample_snapshots(u64 timestamp);
+    void snapshot_on_bbo_change(u64 timestamp);
+    void record_snapshot(u64 timestamp, SnapshotReason reason);
 };
 
 // NEW
@@ -0,0 +1,126 @@
+#include <cstring>
+#include <new>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mman.h>
+#include <linux/mempolicy.h>
+
+#include "placement.hpp"
+
+static constexpr size_t SMALL_PAGE = 4ULL << 10;
+static constexpr size_t HUGE_2MB   = 2ULL << 20;
+static constexpr size_t HUGE_1GB   = 1ULL << 30;
+
+const char* page_size_name(PageSize page_size) {
+    switch (page_size) {
+        case PageSize::SMALL:    return "4K";
+        case PageSize::HUGE_2MB: return "2MB";
+        case PageSize::HUGE_1GB: return "1GB";
+    }
+    return "?";
+}
+
+static size_t round_up(size_t bytes, size_t page) {
+    return (bytes + page - 1) / page * page;
+}
+
+static bool valid_numa_node(int numa_node) {
+    return numa_node >= 0 && numa_node < static_cast<int>(sizeof(unsigned long) * 8);
+}
+
+// Returns nullptr instead of MAP_FAILED so callers can chain fallbacks
+static std::byte* map_pages(size_t bytes, int extra_flags) {
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : static_cast<std::byte*>(ptr);
+}
+
+// hugetlb pages are reserved at mmap time, counted against the nodes the
+// thread's policy allows. Binding the thread to numa_node for the call makes
+// the mmap fail when that node's pool is short, instead of a SIGBUS on first
+// touch once the mapping is bound. node_reserved says whether that happened.
+static std::byte* map_huge_pages(size_t bytes, int extra_flags, int numa_node, bool& node_reserved) {
+    node_reserved = false;
+    if (!valid_numa_node(numa_node)) {
+        return map_pages(bytes, extra_flags);
+    }
+
+    int old_mode = MPOL_DEFAULT;
+    unsigned long old_mask = 0;
+    if (syscall(SYS_get_mempolicy, &old_mode, &old_mask, sizeof(old_mask) * 8, nullptr, 0) != 0) {
+        return nullptr; // can't restore it afterwards, so don't touch it
+    }
+
+    unsigned long mask = 1UL << numa_node;
+    if (syscall(SYS_set_mempolicy, MPOL_BIND, &mask, sizeof(mask) * 8) != 0) {
+        return nullptr;
+    }
+
+    std::byte* data = map_pages(bytes, extra_flags);
+    syscall(SYS_set_mempolicy, old_mode, &old_mask, sizeof(old_mask) * 8);
+
+    node_reserved = data != nullptr;
+    return data;
+}
+
+PageBuffer::PageBuffer(size_t bytes, PageSize requested, int numa_node, bool prefault)
+    : data(nullptr), size(0), page_size(PageSize::SMALL), numa_bound(false), thp_advised(false) {
+    bool node_reserved = false;
+
+    // Explicit huge pages come from the reserved hugetlb pool, which is often empty
+    if (requested == PageSize::HUGE_1GB) {
+        size = round_up(bytes, HUGE_1GB);
+        data = map_huge_pages(size, MAP_HUGETLB | MAP_HUGE_1GB, numa_node, node_reserved);
+        page_size = PageSize::HUGE_1GB;
+    }
+    if (!data && requested != PageSize::SMALL) {
+        size = round_up(bytes, HUGE_2MB);
+        data = map_huge_pages(size, MAP_HUGETLB | MAP_HUGE_2MB, numa_node, node_reserved);
+        page_size = PageSize::HUGE_2MB;
+    }
+    if (!data) {
+        size = round_up(bytes, requested == PageSize::SMALL ? SMALL_PAGE : HUGE_2MB);
+        data = map_pages(size, 0);
+        page_size = PageSize::SMALL;
+
+        if (!data) {
+            throw std::bad_alloc();
+        }
+        if (requested != PageSize::SMALL) {
+            // Best effort, the kernel may still back this with transparent huge pages
+            thp_advised = madvise(data, size, MADV_HUGEPAGE) == 0;
+        }
+    }
+
+    // Bind before the first touch, pages are placed when they fault in.
+    // A hugetlb mapping is only bound if its reservation was made on the node
+    if (valid_numa_node(numa_node) && (page_size == PageSize::SMALL || node_reserved)) {
+        unsigned long mask = 1UL << numa_node;
+        numa_bound = syscall(SYS_mbind, data, size, MPOL_BIND, &mask, sizeof(mask) * 8, 0) == 0;
+    }
+
+    if (prefault) {
+        std::memset(data, 0, size);
+    }
+}
+
+PageBuffer::~PageBuffer() {
+    munmap(data, size);
+}
+
+int current_numa_node() {
+    unsigned cpu = 0, node = 0;
+    if (getcpu(&cpu, &node) != 0) {
+        return -1;
+    }
+    return static_cast<int>(node);
+}
+
+bool pin_current_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
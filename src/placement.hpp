@@ -0,0 +1,45 @@
+#pragma once
+
+#include "util.hpp"
+
+// Page backing for book memory, larger pages cut TLB misses on deep books
+enum class PageSize {
+    SMALL    = 0, // regular 4K pages
+    HUGE_2MB = 1,
+    HUGE_1GB = 2
+};
+
+const char* page_size_name(PageSize page_size);
+
+// Anonymous mapping placed according to the requested page size and NUMA node.
+//
+// Falls back 1GB -> 2MB -> regular pages with transparent huge pages requested,
+// so it always succeeds when plain memory is available. get_page_size() says
+// what the mapping actually ended up using.
+class PageBuffer {
+public:
+    PageBuffer(size_t bytes, PageSize page_size, int numa_node, bool prefault);
+    ~PageBuffer();
+
+    PageBuffer(const PageBuffer&) = delete;
+    PageBuffer& operator=(const PageBuffer&) = delete;
+
+    std::byte* get_data() const { return data; }
+    size_t get_size() const { return size; }
+    PageSize get_page_size() const { return page_size; }
+    bool is_numa_bound() const { return numa_bound; }
+    bool is_thp_advised() const { return thp_advised; }
+
+private:
+    std::byte* data;
+    size_t size;
+    PageSize page_size;
+    bool numa_bound;
+    bool thp_advised;
+};
+
+// NUMA node of the CPU the calling thread is running on
+int current_numa_node();
+
+// Restricts the calling thread to one CPU, returns false if the kernel refused
+bool pin_current_thread(int cpu);
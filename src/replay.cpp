@@ -0,0 +1,547 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "replay.hpp"
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+// Read-only mapping of a whole input file, shared through the page cache
+// by every partition task of the same file
+struct MappedFile {
+    const std::byte* data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open " + path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("failed to stat " + path);
+        }
+
+        size = st.st_size;
+        if (size > 0) {
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("failed to mmap " + path);
+            }
+            data = static_cast<const std::byte*>(mapped);
+            madvise(mapped, size, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (data) {
+            munmap(const_cast<std::byte*>(data), size);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+static OrderMessage decode_message(const std::byte* ptr) {
+    switch (static_cast<char>(*ptr)) {
+#define X(code, type) case code: { type msg; std::memcpy(&msg, ptr, sizeof(type)); return msg; }
+        MESSAGE_LIST
+#undef X
+        default: return std::monostate{};
+    }
+}
+
+// One deque per worker. A worker takes from the front of its own deque, which
+// was dealt largest task first, and steals from the back of the others so the
+// small leftovers move rather than the big ones.
+class WorkStealingQueues {
+public:
+    explicit WorkStealingQueues(u32 workers) : queues(workers) {}
+
+    void push(u32 worker, u32 task) {
+        queues[worker].tasks.push_back(task);
+    }
+
+    // task index and whether it was stolen, nullopt once every deque is empty
+    std::optional<std::pair<u32, bool>> next(u32 worker) {
+        {
+            Queue& own = queues[worker];
+            std::lock_guard lock(own.mutex);
+            if (!own.tasks.empty()) {
+                u32 task = own.tasks.front();
+                own.tasks.pop_front();
+                return std::pair{ task, false };
+            }
+        }
+
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue& victim = queues[(worker + i) % queues.size()];
+            std::lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                u32 task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return std::pair{ task, true };
+            }
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<u32> tasks;
+    };
+
+    std::vector<Queue> queues;
+};
+
+struct ReplayTask {
+    std::string file;
+    u32 file_index;
+    u32 partition;
+    u64 estimated_bytes;
+};
+
+// Inputs often share a stem (12302019.NASDAQ_ITCH50 and 12302019.BX_ITCH50,
+// day1/itch.bin and day2/itch.bin), the input's index keeps their outputs apart
+static std::string output_name(const ReplayConfig& config, u32 file_index) {
+    return std::to_string(file_index) + "-" + fs::path(config.files[file_index]).stem().string();
+}
+
+static fs::path part_path(const ReplayConfig& config, const ReplayTask& task, const char* extension) {
+    return fs::path(config.output_dir) / (output_name(config, task.file_index) + ".p" + std::to_string(task.partition) + extension);
+}
+
+static fs::path merged_path(const ReplayConfig& config, u32 file_index, const char* extension) {
+    return fs::path(config.output_dir) / (output_name(config, file_index) + extension);
+}
+
+static f64 seconds_since(Clock::time_point start) {
+    return std::chrono::duration<f64>(Clock::now() - start).count();
+}
+
+static void run_task(const ReplayConfig& config, const ReplayTask& task, ReplayTaskResult& result, Clock::time_point replay_start) {
+    result.start_seconds = seconds_since(replay_start);
+
+    MappedFile file(task.file);
+
+    std::unique_ptr<SnapshotSink> sink;
+    if (config.write_snapshots) {
+        SnapshotConfig snapshot = config.snapshot;
+        snapshot.path = part_path(config, task, ".obs").string();
+        sink = std::make_unique<SnapshotSink>(snapshot);
+    }
+
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> tape(nullptr, &std::fclose);
+    if (config.write_tape) {
+        tape.reset(std::fopen(part_path(config, task, ".tape").c_str(), "wb"));
+        if (!tape) {
+            throw std::runtime_error("failed to open tape output for " + task.file);
+        }
+        std::setvbuf(tape.get(), nullptr, _IOFBF, 1 << 20);
+    }
+
+    auto write_tape = [&](u64 timestamp, u16 locate, char kind, u64 match_number, f32 price, u32 shares) {
+        TapeEntry entry{
+            .timestamp = timestamp, .match_number = match_number, .price = price, .shares = shares,
+            .stock_locate = locate, .kind = kind, .reserved = {}
+        };
+        if (std::fwrite(&entry, sizeof(entry), 1, tape.get()) != 1) {
+            throw std::runtime_error("failed writing tape output for " + task.file);
+        }
+        ++result.tape_entries;
+    };
+
+    // stock_locate is a u16, so a flat table beats hashing
+    std::vector<std::unique_ptr<OrderBook>> books(1 << 16);
+    const u32 partitions = config.partitions_per_file;
+
+    const std::byte* ptr = file.data;
+    const std::byte* end = file.data + file.size;
+
+    u64 session_end = 0; // latest timestamp in the file, whichever partition it belongs to
+
+    while (ptr < end) {
+        const size_t size = get_message_size(static_cast<char>(*ptr));
+        if (size == 0 || ptr + size > end) {
+            throw std::runtime_error("unknown or truncated message at offset " + std::to_string(ptr - file.data));
+        }
+
+        MessageHeader header;
+        std::memcpy(&header, ptr, sizeof(header));
+        const u16 locate = header.stock_locate;
+        session_end = std::max(session_end, static_cast<u64>(header.timestamp));
+
+        if (locate % partitions != task.partition) {
+            ptr += size;
+            continue;
+        }
+        ++result.messages;
+
+        OrderMessage message = decode_message(ptr);
+        ptr += size;
+
+        auto& book = books[locate];
+
+        if (tape) {
+            std::visit(overloaded {
+                [&](const OrderExecutedMessage& msg) {
+                    // plain executions happen at the resting order's price
+                    if (const Order* order = book ? book->find_order(msg.order_reference_number) : nullptr) {
+                        write_tape(header.timestamp, locate, 'E', msg.match_number, order->price, msg.executed_shares);
+                    }
+                },
+                [&](const OrderExecutedwithPriceMessage& msg) {
+                    write_tape(header.timestamp, locate, 'C', msg.match_number, msg.execution_price, msg.executed_shares);
+                },
+                [&](const TradeMessage& msg) {
+                    write_tape(header.timestamp, locate, 'P', msg.match_number, msg.price, msg.shares);
+                },
+                [&](const CrossTradeMessage& msg) {
+                    write_tape(header.timestamp, locate, 'Q', msg.match_number, msg.cross_price, static_cast<u32>(msg.shares));
+                },
+                [](const auto&) {}
+            }, message);
+        }
+
+        if (!book) {
+            // books start on their first add, anything before that has nothing to act on
+            const char* stock = std::visit(overloaded {
+                [](const AddOrderNoMPIDMessage& msg) -> const char* { return msg.stock; },
+                [](const AddOrderWithMPIDMessage& msg) -> const char* { return msg.stock; },
+                [](const auto&) -> const char* { return nullptr; }
+            }, message);
+            if (!stock) {
+                continue;
+            }
+
+            book = std::make_unique<OrderBook>(std::string(stock, strnlen(stock, 8)), 0.01, config.book);
+            if (sink) {
+                book->attach_snapshot_sink(sink.get(), locate);
+            }
+            ++result.books;
+        }
+
+        // Only the book's own rejects are counted, the book is untouched by them.
+        // Anything else (bad_alloc from a full arena) fails the task
+        try {
+            book->submit_message(message);
+        } catch (const std::out_of_range&) {
+            ++result.rejected; // unknown order id
+        } catch (const std::runtime_error&) {
+            ++result.rejected; // add for a different symbol than the book's
+        } catch (const std::bad_alloc&) {
+            throw std::runtime_error("book for locate " + std::to_string(locate) + " (" + book->get_symbol() +
+                                     ") ran out of its " + std::to_string(config.book.arena_bytes >> 20) +
+                                     "MB arena, raise --arena-mb");
+        }
+    }
+
+    result.bytes = file.size;
+
+    if (sink) {
+        // quiet books still owe a sample for every boundary up to the end of the file
+        for (const auto& book : books) {
+            if (book) {
+                book->flush_snapshots(session_end);
+            }
+        }
+        sink->close();
+        result.dropped_snapshot_rows = sink->get_dropped_rows();
+    }
+    if (tape && std::fclose(tape.release()) != 0) {
+        throw std::runtime_error("failed writing tape output for " + task.file);
+    }
+
+    result.end_seconds = seconds_since(replay_start);
+}
+
+// Partitions of one file are each in time order, a k-way merge keeps the whole tape that way
+static void merge_tapes(const std::vector<fs::path>& parts, const fs::path& out_path) {
+    std::vector<std::unique_ptr<MappedFile>> files;
+    for (const auto& part : parts) {
+        files.push_back(std::make_unique<MappedFile>(part.string()));
+    }
+
+    std::FILE* out = std::fopen(out_path.c_str(), "wb");
+    if (!out) {
+        throw std::runtime_error("failed to open " + out_path.string());
+    }
+    std::setvbuf(out, nullptr, _IOFBF, 1 << 20);
+
+    struct Cursor {
+        const TapeEntry* at;
+        const TapeEntry* end;
+        size_t part;
+    };
+    auto later = [](const Cursor& a, const Cursor& b) {
+        return a.at->timestamp != b.at->timestamp ? a.at->timestamp > b.at->timestamp : a.part > b.part;
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> heap(later);
+
+    for (size_t i = 0; i < files.size(); i++) {
+        const auto* entries = reinterpret_cast<const TapeEntry*>(files[i]->data);
+        const size_t count = files[i]->size / sizeof(TapeEntry);
+        if (count > 0) {
+            heap.push({ entries, entries + count, i });
+        }
+    }
+
+    while (!heap.empty()) {
+        Cursor cursor = heap.top();
+        heap.pop();
+        if (std::fwrite(cursor.at, sizeof(TapeEntry), 1, out) != 1) {
+            std::fclose(out);
+            throw std::runtime_error("failed writing " + out_path.string());
+        }
+        if (++cursor.at != cursor.end) {
+            heap.push(cursor);
+        }
+    }
+
+    if (std::fclose(out) != 0) {
+        throw std::runtime_error("failed writing " + out_path.string());
+    }
+}
+
+// Snapshot blocks are self-describing, so merging is one header followed by every part's blocks
+static void merge_snapshots(const std::vector<fs::path>& parts, const fs::path& out_path) {
+    std::FILE* out = std::fopen(out_path.c_str(), "wb");
+    if (!out) {
+        throw std::runtime_error("failed to open " + out_path.string());
+    }
+
+    for (size_t i = 0; i < parts.size(); i++) {
+        MappedFile part(parts[i].string());
+        if (part.size < sizeof(SnapshotFileHeader)) {
+            continue;
+        }
+        const size_t skip = (i == 0) ? 0 : sizeof(SnapshotFileHeader);
+        if (part.size == skip) {
+            continue; // header only, the task took no snapshots
+        }
+        if (std::fwrite(part.data + skip, part.size - skip, 1, out) != 1) {
+            std::fclose(out);
+            throw std::runtime_error("failed writing " + out_path.string());
+        }
+    }
+
+    if (std::fclose(out) != 0) {
+        throw std::runtime_error("failed writing " + out_path.string());
+    }
+}
+
+// Files with a failed task keep their parts as they are, a merge would pass off partial output as whole
+static void merge_outputs(const ReplayConfig& config, const std::vector<ReplayTask>& tasks,
+                          const std::vector<ReplayTaskResult>& results) {
+    for (u32 file_index = 0; file_index < config.files.size(); file_index++) {
+        std::vector<const ReplayTask*> file_tasks;
+        bool failed = false;
+        for (size_t i = 0; i < tasks.size(); i++) {
+            if (tasks[i].file_index == file_index) {
+                file_tasks.push_back(&tasks[i]);
+                failed |= !results[i].error.empty();
+            }
+        }
+        if (failed) {
+            continue;
+        }
+        std::sort(file_tasks.begin(), file_tasks.end(),
+                  [](const ReplayTask* a, const ReplayTask* b) { return a->partition < b->partition; });
+
+        auto merge = [&](const char* extension, auto merge_parts) {
+            std::vector<fs::path> parts;
+            for (const auto* task : file_tasks) {
+                fs::path part = part_path(config, *task, extension);
+                if (fs::exists(part)) {
+                    parts.push_back(part);
+                }
+            }
+            if (parts.empty()) {
+                return;
+            }
+
+            fs::path out = merged_path(config, file_index, extension);
+            if (parts.size() == 1) {
+                fs::rename(parts[0], out);
+                return;
+            }
+            merge_parts(parts, out);
+            for (const auto& part : parts) {
+                fs::remove(part);
+            }
+        };
+
+        if (config.write_tape) {
+            merge(".tape", merge_tapes);
+        }
+        if (config.write_snapshots) {
+            merge(".obs", merge_snapshots);
+        }
+    }
+}
+
+ReplayReport run_replay(const ReplayConfig& config) {
+    if (config.partitions_per_file == 0) {
+        throw std::runtime_error("ReplayConfig partitions_per_file must be non-zero");
+    }
+
+    const u32 hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    const u32 threads = config.threads ? config.threads : hardware_threads;
+
+    fs::create_directories(config.output_dir);
+
+    std::vector<ReplayTask> tasks;
+    for (u32 i = 0; i < config.files.size(); i++) {
+        const u64 size = fs::file_size(config.files[i]);
+        for (u32 partition = 0; partition < config.partitions_per_file; partition++) {
+            tasks.push_back({ config.files[i], i, partition, size / config.partitions_per_file });
+        }
+    }
+
+    // Deal largest first, round robin, so stealing only has to even out the tail
+    std::vector<u32> order(tasks.size());
+    for (u32 i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](u32 a, u32 b) { return tasks[a].estimated_bytes > tasks[b].estimated_bytes; });
+
+    WorkStealingQueues queues(threads);
+    for (u32 i = 0; i < order.size(); i++) {
+        queues.push(i % threads, order[i]);
+    }
+
+    ReplayReport report{ .threads = threads, .wall_seconds = 0, .merge_seconds = 0, .merge_error = {}, .tasks = {} };
+    report.tasks.resize(tasks.size());
+
+    const auto start = Clock::now();
+
+    auto worker = [&](u32 id) {
+        if (config.pin_threads) {
+            pin_current_thread(id % hardware_threads);
+        }
+
+        while (auto next = queues.next(id)) {
+            auto [index, stolen] = *next;
+            ReplayTaskResult& result = report.tasks[index];
+            result.file = tasks[index].file;
+            result.partition = tasks[index].partition;
+            result.worker = id;
+            result.stolen = stolen;
+
+            try {
+                run_task(config, tasks[index], result, start);
+            } catch (const std::exception& e) {
+                result.error = e.what();
+                result.end_seconds = seconds_since(start);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (u32 id = 0; id < threads; id++) {
+        workers.emplace_back(worker, id);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    report.wall_seconds = seconds_since(start);
+
+    const auto merge_start = Clock::now();
+    try {
+        merge_outputs(config, tasks, report.tasks);
+    } catch (const std::exception& e) {
+        report.merge_error = e.what();
+    }
+    report.merge_seconds = seconds_since(merge_start);
+
+    return report;
+}
+
+bool ReplayReport::ok() const {
+    return merge_error.empty() &&
+           std::all_of(tasks.begin(), tasks.end(), [](const ReplayTaskResult& task) { return task.error.empty(); });
+}
+
+void ReplayReport::print(std::ostream& os) const {
+    os << std::fixed << std::setprecision(3);
+    os << "task  worker  stolen  seconds  messages  Mmsg/s  MB/s  books  rejected  file" << std::endl;
+
+    f64 task_seconds = 0;
+    u64 messages = 0;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        const auto& task = tasks[i];
+        const f64 seconds = std::max(task.get_seconds(), 1e-9);
+        task_seconds += task.get_seconds();
+        messages += task.messages;
+
+        os << std::setw(4) << i << "  " << std::setw(6) << task.worker << "  " << std::setw(6) << (task.stolen ? "yes" : "no")
+           << "  " << std::setw(7) << task.get_seconds() << "  " << std::setw(8) << task.messages
+           << "  " << std::setw(6) << task.messages / seconds / 1e6 << "  " << std::setw(4) << task.bytes / seconds / 1e6
+           << "  " << std::setw(5) << task.books << "  " << std::setw(8) << task.rejected
+           << "  " << task.file << " [" << task.partition << "]";
+        if (!task.error.empty()) {
+            os << "  FAILED: " << task.error;
+        }
+        if (task.dropped_snapshot_rows) {
+            os << "  dropped " << task.dropped_snapshot_rows << " snapshot rows";
+        }
+        os << std::endl;
+    }
+
+    os << "wall " << wall_seconds << "s on " << threads << " threads, " << task_seconds << "s of task time, "
+       << "speedup " << task_seconds / std::max(wall_seconds, 1e-9) << "x, "
+       << messages / std::max(wall_seconds, 1e-9) / 1e6 << " Mmsg/s overall, merge " << merge_seconds << "s" << std::endl;
+    if (!merge_error.empty()) {
+        os << "MERGE FAILED: " << merge_error << std::endl;
+    }
+
+    if (tasks.empty()) {
+        return;
+    }
+
+    // the first worker to run dry marks where the pool stopped being fully busy
+    std::vector<f64> worker_done(threads, 0.0);
+    for (const auto& task : tasks) {
+        worker_done[task.worker] = std::max(worker_done[task.worker], task.end_seconds);
+    }
+    const f64 first_idle = *std::min_element(worker_done.begin(), worker_done.end());
+    os << "first worker idle at " << first_idle << "s, tail " << wall_seconds - first_idle << "s" << std::endl;
+
+    std::vector<f64> durations;
+    for (const auto& task : tasks) {
+        durations.push_back(task.get_seconds());
+    }
+    std::nth_element(durations.begin(), durations.begin() + durations.size() / 2, durations.end());
+    const f64 median = durations[durations.size() / 2];
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+        if (tasks[i].get_seconds() > 1.5 * median) {
+            os << "straggler: task " << i << " took " << tasks[i].get_seconds() << "s, "
+               << tasks[i].get_seconds() / std::max(median, 1e-9) << "x the median" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "orderbook.hpp"
+
+// Batch replay of many ITCH files on a work-stealing pool.
+//
+// Files are split into tasks, one per (file, symbol partition); a partition
+// owns every stock_locate with locate % partitions_per_file == partition, so
+// each task builds its own books and never shares one. Task outputs go to
+// per-task files and are merged per input file once every task is done,
+// into <output_dir>/<index>-<stem>.tape and .obs, index being the file's
+// position in ReplayConfig::files.
+//
+// Files are read in the same layout edit_book() expects: messages back to
+// back, sized by get_message_size() from the leading type byte.
+
+struct ReplayConfig {
+    std::vector<std::string> files;
+    std::string output_dir = ".";
+
+    u32  threads             = 0;     // 0 = std::thread::hardware_concurrency()
+    u32  partitions_per_file = 1;
+    bool pin_threads         = false; // worker i runs on cpu i
+
+    bool write_tape      = true;  // executions and trades, <file>.tape
+    bool write_snapshots = false; // depth snapshots, <file>.obs
+    SnapshotConfig snapshot;      // path is ignored, every task gets its own
+
+    // One book per symbol, most of which stay small, so the order table starts
+    // tiny and grows. An empty book is ~12KB resident, the arena is address space
+    // until touched, so it is sized for the busiest symbol (~2M live orders).
+    // A book that still runs out fails its task, naming the locate
+    BookConfig book = { .arena_bytes = 256ULL << 20, .max_orders = 1ULL << 8 };
+};
+
+// One execution or trade print, 32 bytes so a tape file can be mmapped as an array
+struct TapeEntry {
+    u64  timestamp;
+    u64  match_number;
+    f32  price;
+    u32  shares;
+    u16  stock_locate;
+    char kind;        // ITCH message type that produced it: 'E', 'C', 'P' or 'Q'
+    u8   reserved[5];
+};
+
+struct ReplayTaskResult {
+    std::string file;
+    u32  partition;
+    u32  worker;
+    bool stolen;          // ran on a worker other than the one it was dealt to
+
+    u64 bytes;            // file bytes scanned
+    u64 messages;         // messages that belonged to this partition
+    u64 rejected;         // messages the book threw on, e.g. unknown order ids
+    u64 books;
+    u64 tape_entries;
+    u64 dropped_snapshot_rows;
+
+    f64 start_seconds;    // relative to the start of the replay
+    f64 end_seconds;
+    std::string error;    // set if the task died, its outputs are then incomplete
+
+    f64 get_seconds() const { return end_seconds - start_seconds; }
+};
+
+struct ReplayReport {
+    u32 threads;
+    f64 wall_seconds;
+    f64 merge_seconds;
+    std::string merge_error; // set if writing a merged output failed
+    std::vector<ReplayTaskResult> tasks;
+
+    bool ok() const;
+
+    // Per-task throughput, then tasks that ran well past the median
+    void print(std::ostream& os) const;
+};
+
+ReplayReport run_replay(const ReplayConfig& config);
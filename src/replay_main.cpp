@@ -0,0 +1,58 @@
+#include <cstring>
+
+#include "replay.hpp"
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [-j threads] [-p partitions per file] [-o output dir]"
+              << " [--pin] [--snapshots] [--no-tape] [--arena-mb n] [--max-orders n] files...\n"
+              << "  --arena-mb    address space per symbol's book, default 256, only touched pages are resident\n"
+              << "  --max-orders  order table buckets reserved per book, default 256, grows as needed" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    ReplayConfig config;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (!std::strcmp(arg, "-j") && has_value) {
+            config.threads = std::stoul(argv[++i]);
+        } else if (!std::strcmp(arg, "-p") && has_value) {
+            config.partitions_per_file = std::stoul(argv[++i]);
+        } else if (!std::strcmp(arg, "-o") && has_value) {
+            config.output_dir = argv[++i];
+        } else if (!std::strcmp(arg, "--arena-mb") && has_value) {
+            config.book.arena_bytes = std::stoull(argv[++i]) << 20;
+        } else if (!std::strcmp(arg, "--max-orders") && has_value) {
+            config.book.max_orders = std::stoull(argv[++i]);
+        } else if (!std::strcmp(arg, "--pin")) {
+            config.pin_threads = true;
+        } else if (!std::strcmp(arg, "--snapshots")) {
+            config.write_snapshots = true;
+        } else if (!std::strcmp(arg, "--no-tape")) {
+            config.write_tape = false;
+        } else if (arg[0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else {
+            config.files.push_back(arg);
+        }
+    }
+
+    if (config.files.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    ReplayReport report;
+    try {
+        report = run_replay(config);
+    } catch (const std::exception& e) {
+        std::cerr << "replay failed: " << e.what() << std::endl;
+        return 1;
+    }
+    report.print(std::cout);
+
+    return report.ok() ? 0 : 1;
+}
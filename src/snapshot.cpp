@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.hpp"
+
+static size_t align8(size_t bytes) {
+    return (bytes + 7) & ~size_t(7);
+}
+
+// Byte size of one block's columns, excluding its header
+static size_t column_bytes(size_t rows, size_t depth, bool delta_timestamps) {
+    size_t bytes = align8(rows * (delta_timestamps ? sizeof(u32) : sizeof(u64)));
+    bytes += align8(rows * sizeof(u16));
+    bytes += align8(rows * sizeof(u8));
+    bytes += 2 * (align8(depth * rows * sizeof(f32)) + align8(depth * rows * sizeof(u32)));
+    return bytes;
+}
+
+SnapshotSink::SnapshotSink(const SnapshotConfig& cfg)
+    : config(cfg), file(nullptr), current(nullptr),
+      full_head(0), full_count(0), stopping(false),
+      rows_written(0), dropped_rows(0), write_error(0) {
+    if (config.depth == 0 || config.depth > SNAPSHOT_MAX_DEPTH) {
+        throw std::runtime_error("SnapshotSink depth must be between 1 and SNAPSHOT_MAX_DEPTH");
+    }
+    if (config.rows_per_block == 0 || config.pending_blocks == 0) {
+        throw std::runtime_error("SnapshotSink rows_per_block and pending_blocks must be non-zero");
+    }
+
+    file = std::fopen(config.path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("SnapshotSink failed to open " + config.path);
+    }
+
+    SnapshotFileHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.depth = config.depth;
+    header.rows_per_block = config.rows_per_block;
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::fclose(file);
+        throw std::runtime_error("SnapshotSink failed to write the header of " + config.path);
+    }
+
+    // everything is sized up front so appending never allocates
+    const size_t rows = config.rows_per_block;
+    const size_t cells = rows * config.depth;
+    for (u32 i = 0; i < config.pending_blocks + 1; i++) {
+        auto block = std::make_unique<Block>();
+        block->timestamps.resize(rows);
+        block->locates.resize(rows);
+        block->reasons.resize(rows);
+        block->bid_prices.resize(cells);
+        block->bid_sizes.resize(cells);
+        block->ask_prices.resize(cells);
+        block->ask_sizes.resize(cells);
+        blocks.push_back(std::move(block));
+    }
+
+    current = blocks[0].get();
+    for (size_t i = 1; i < blocks.size(); i++) {
+        free_blocks.push_back(blocks[i].get());
+    }
+    full_blocks.resize(blocks.size());
+    encode_buffer.resize(sizeof(SnapshotBlockHeader) + column_bytes(config.rows_per_block, config.depth, false));
+
+    writer = std::thread(&SnapshotSink::writer_loop, this);
+}
+
+SnapshotSink::~SnapshotSink() {
+    // write errors only surface through an explicit close()
+    try {
+        close();
+    } catch (const std::exception&) {}
+}
+
+void SnapshotSink::append(u64 timestamp, u16 stock_locate, SnapshotReason reason,
+                          const f32* bid_prices, const u32* bid_sizes,
+                          const f32* ask_prices, const u32* ask_sizes) {
+    if (!current && !reclaim_block()) {
+        ++dropped_rows;
+        return;
+    }
+
+    const u32 row = current->rows++;
+    const u32 stride = config.rows_per_block;
+
+    current->timestamps[row] = timestamp;
+    current->locates[row] = stock_locate;
+    current->reasons[row] = static_cast<u8>(reason);
+    for (u32 level = 0; level < config.depth; level++) {
+        current->bid_prices[level * stride + row] = bid_prices[level];
+        current->bid_sizes[level * stride + row]  = bid_sizes[level];
+        current->ask_prices[level * stride + row] = ask_prices[level];
+        current->ask_sizes[level * stride + row]  = ask_sizes[level];
+    }
+
+    if (current->rows == config.rows_per_block) {
+        submit_block();
+    }
+}
+
+void SnapshotSink::submit_block() {
+    std::lock_guard lock(mutex);
+
+    full_blocks[(full_head + full_count) % full_blocks.size()] = current;
+    ++full_count;
+
+    if (free_blocks.empty()) {
+        current = nullptr; // writer is behind, drop rows until a block comes back
+    } else {
+        current = free_blocks.back();
+        free_blocks.pop_back();
+    }
+
+    ready.notify_one();
+}
+
+bool SnapshotSink::reclaim_block() {
+    std::lock_guard lock(mutex);
+    if (free_blocks.empty()) {
+        return false;
+    }
+    current = free_blocks.back();
+    free_blocks.pop_back();
+    return true;
+}
+
+void SnapshotSink::close() {
+    if (!file) {
+        return;
+    }
+
+    {
+        std::unique_lock lock(mutex);
+        if (!current) {
+            drained.wait(lock, [this] { return !free_blocks.empty(); });
+            current = free_blocks.back();
+            free_blocks.pop_back();
+        }
+    }
+    if (current->rows > 0) {
+        submit_block();
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    ready.notify_one();
+    writer.join();
+
+    if (std::fclose(file) != 0 && write_error == 0) {
+        write_error = errno;
+    }
+    file = nullptr;
+
+    if (write_error != 0) {
+        throw std::runtime_error("SnapshotSink failed writing " + config.path + ": " + std::strerror(write_error));
+    }
+}
+
+void SnapshotSink::writer_loop() {
+    std::unique_lock lock(mutex);
+
+    while (true) {
+        ready.wait(lock, [this] { return full_count > 0 || stopping; });
+        if (full_count == 0) {
+            return;
+        }
+
+        Block* block = full_blocks[full_head];
+        full_head = (full_head + 1) % full_blocks.size();
+        --full_count;
+
+        lock.unlock();
+        write_block(*block);
+        block->rows = 0;
+        lock.lock();
+
+        free_blocks.push_back(block);
+        drained.notify_one();
+    }
+}
+
+void SnapshotSink::write_block(const Block& block) {
+    if (write_error != 0) {
+        return; // file is already short a block, anything after it would be misplaced
+    }
+
+    const u32 rows = block.rows;
+    const u32 stride = config.rows_per_block;
+
+    // rows aren't in time order, so offsets are taken from the earliest one;
+    // they only fit the narrow column if the block spans under ~4.29s
+    const auto [earliest, latest] = std::minmax_element(block.timestamps.begin(), block.timestamps.begin() + rows);
+    const u64 base = *earliest;
+    const bool delta = config.delta_timestamps && *latest - base <= std::numeric_limits<u32>::max();
+
+    const size_t block_bytes = sizeof(SnapshotBlockHeader) + column_bytes(rows, config.depth, delta);
+    std::byte* out = encode_buffer.data();
+    std::memset(out, 0, block_bytes);
+
+    SnapshotBlockHeader header {
+        .rows = rows,
+        .flags = delta ? SNAPSHOT_DELTA_TIMESTAMPS : 0u,
+        .base_timestamp = base,
+        .block_bytes = block_bytes
+    };
+    std::memcpy(out, &header, sizeof(header));
+    size_t offset = sizeof(header);
+
+    if (delta) {
+        for (u32 row = 0; row < rows; row++) {
+            u32 offset_ns = static_cast<u32>(block.timestamps[row] - base);
+            std::memcpy(out + offset + row * sizeof(u32), &offset_ns, sizeof(u32));
+        }
+        offset += align8(rows * sizeof(u32));
+    } else {
+        std::memcpy(out + offset, block.timestamps.data(), rows * sizeof(u64));
+        offset += align8(rows * sizeof(u64));
+    }
+
+    std::memcpy(out + offset, block.locates.data(), rows * sizeof(u16));
+    offset += align8(rows * sizeof(u16));
+    std::memcpy(out + offset, block.reasons.data(), rows * sizeof(u8));
+    offset += align8(rows * sizeof(u8));
+
+    // in memory a level column is rows_per_block long, on disk it is cut to rows
+    // and the levels of one field sit back to back
+    auto write_levels = [&](const auto& column) {
+        using T = typename std::decay_t<decltype(column)>::value_type;
+        for (u32 level = 0; level < config.depth; level++) {
+            std::memcpy(out + offset + level * rows * sizeof(T), column.data() + level * stride, rows * sizeof(T));
+        }
+        offset += align8(config.depth * rows * sizeof(T));
+    };
+    write_levels(block.bid_prices);
+    write_levels(block.bid_sizes);
+    write_levels(block.ask_prices);
+    write_levels(block.ask_sizes);
+
+    if (std::fwrite(out, block_bytes, 1, file) != 1) {
+        write_error = errno ? errno : EIO;
+        return;
+    }
+    rows_written += rows;
+}
+
+u64 SnapshotReader::BlockView::timestamp(u32 row) const {
+    if (header->flags & SNAPSHOT_DELTA_TIMESTAMPS) {
+        return header->base_timestamp + static_cast<const u32*>(timestamps)[row];
+    }
+    return static_cast<const u64*>(timestamps)[row];
+}
+
+SnapshotReader::SnapshotReader(const std::string& path) : data(nullptr), size(0), header(nullptr) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("SnapshotReader failed to open " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotFileHeader)) {
+        ::close(fd);
+        throw std::runtime_error("SnapshotReader " + path + " is too small to be a snapshot file");
+    }
+
+    size = st.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("SnapshotReader failed to mmap " + path);
+    }
+    data = static_cast<const std::byte*>(mapped);
+
+    header = reinterpret_cast<const SnapshotFileHeader*>(data);
+    if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        munmap(const_cast<std::byte*>(data), size);
+        throw std::runtime_error("SnapshotReader " + path + " has a bad magic");
+    }
+
+    auto malformed = [&](const std::string& what) {
+        munmap(const_cast<std::byte*>(data), size);
+        return std::runtime_error("SnapshotReader " + path + " " + what);
+    };
+
+    const u32 depth = header->depth;
+    if (depth == 0 || depth > SNAPSHOT_MAX_DEPTH) {
+        throw malformed("has a bad depth");
+    }
+    size_t offset = sizeof(SnapshotFileHeader);
+
+    while (offset + sizeof(SnapshotBlockHeader) <= size) {
+        const std::byte* base = data + offset;
+        const auto* block = reinterpret_cast<const SnapshotBlockHeader*>(base);
+
+        // the columns are located from rows, so the stated size has to agree with them
+        const bool delta = block->flags & SNAPSHOT_DELTA_TIMESTAMPS;
+        if (block->rows > header->rows_per_block ||
+            block->block_bytes != sizeof(SnapshotBlockHeader) + column_bytes(block->rows, depth, delta)) {
+            throw malformed("has a corrupt block at offset " + std::to_string(offset));
+        }
+        if (offset + block->block_bytes > size) {
+            break; // truncated tail, writer was cut off mid block
+        }
+
+        const u32 rows = block->rows;
+        size_t column = sizeof(SnapshotBlockHeader);
+        auto next = [&](size_t element_size) {
+            const std::byte* ptr = base + column;
+            column += align8(rows * element_size);
+            return ptr;
+        };
+
+        BlockView view;
+        view.header     = block;
+        view.depth      = depth;
+        view.timestamps = next((block->flags & SNAPSHOT_DELTA_TIMESTAMPS) ? sizeof(u32) : sizeof(u64));
+        view.locates    = reinterpret_cast<const u16*>(next(sizeof(u16)));
+        view.reasons    = reinterpret_cast<const u8*>(next(sizeof(u8)));
+
+        view.bid_prices = reinterpret_cast<const f32*>(next(depth * sizeof(f32)));
+        view.bid_sizes  = reinterpret_cast<const u32*>(next(depth * sizeof(u32)));
+        view.ask_prices = reinterpret_cast<const f32*>(next(depth * sizeof(f32)));
+        view.ask_sizes  = reinterpret_cast<const u32*>(next(depth * sizeof(u32)));
+
+        blocks.push_back(view);
+        offset += block->block_bytes;
+    }
+}
+
+SnapshotReader::~SnapshotReader() {
+    munmap(const_cast<std::byte*>(data), size);
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util.hpp"
+
+// Columnar snapshot file, laid out so it can be mmapped and read in place:
+//
+//   SnapshotFileHeader
+//   repeated blocks of
+//     SnapshotBlockHeader
+//     timestamp column   u64[rows], or u32[rows] offsets from base_timestamp when delta encoded
+//     locate column      u16[rows]
+//     reason column      u8[rows]
+//     bid price columns  f32[rows] per level, best level first, levels back to back
+//     bid size columns   u32[rows] per level
+//     ask price columns  f32[rows] per level
+//     ask size columns   u32[rows] per level
+//
+// Every column group starts on an 8 byte boundary. Empty levels are written as price 0, size 0.
+//
+// Rows are in the order they were appended, not time order. Books sharing a
+// sink interleave, and a quiet book's periodic samples are only written when
+// its next message arrives (or when OrderBook::flush_snapshots() is called),
+// behind newer rows from busier books. Sort on the timestamp column if order matters.
+
+static constexpr char SNAPSHOT_MAGIC[8] = { 'O', 'B', 'S', 'N', 'A', 'P', '0', '1' };
+static constexpr u32  SNAPSHOT_MAX_DEPTH = 32;
+
+enum class SnapshotReason : u8 {
+    SAMPLE = 'S', // periodic sample, timestamp is the sample boundary
+    BBO    = 'B'  // best bid or offer changed, timestamp is the message time
+};
+
+enum SnapshotBlockFlags : u32 {
+    SNAPSHOT_DELTA_TIMESTAMPS = 1 << 0
+};
+
+struct SnapshotFileHeader {
+    char magic[8];
+    u32  depth;
+    u32  rows_per_block;
+};
+
+struct SnapshotBlockHeader {
+    u32 rows;
+    u32 flags;
+    u64 base_timestamp; // earliest row's timestamp, delta encoded offsets are from this
+    u64 block_bytes;    // header included, the next block starts this far after this one
+};
+
+struct SnapshotConfig {
+    std::string path;
+    u32  depth             = 10;
+    u64  sample_interval   = 100'000'000; // ns, 0 turns periodic sampling off
+    bool sample_on_bbo     = true;
+    bool delta_timestamps  = true;
+    u32  rows_per_block    = 16'384;
+    u32  pending_blocks    = 64;          // blocks preallocated for the writer to fall behind by
+};
+
+// Buffers snapshot rows into columnar blocks and hands full blocks to a
+// background writer thread, so the book thread never waits on the disk.
+//
+// One producer thread per sink. Blocks are all preallocated; if the writer
+// falls pending_blocks behind, rows are dropped and counted rather than
+// blocking the book.
+class SnapshotSink {
+public:
+    explicit SnapshotSink(const SnapshotConfig& config);
+    ~SnapshotSink();
+
+    SnapshotSink(const SnapshotSink&) = delete;
+    SnapshotSink& operator=(const SnapshotSink&) = delete;
+
+    void append(u64 timestamp, u16 stock_locate, SnapshotReason reason,
+                const f32* bid_prices, const u32* bid_sizes,
+                const f32* ask_prices, const u32* ask_sizes);
+
+    // Flushes the partial block and waits for the writer to drain.
+    // Throws if any write failed, the file is then incomplete
+    void close();
+
+    const SnapshotConfig& get_config() const { return config; }
+    u64 get_rows_written() const { return rows_written; } // only settled after close()
+    u64 get_dropped_rows() const { return dropped_rows; }
+
+private:
+    struct Block {
+        u32 rows = 0;
+        std::vector<u64> timestamps;
+        std::vector<u16> locates;
+        std::vector<u8>  reasons;
+        std::vector<f32> bid_prices; // [level * rows_per_block + row]
+        std::vector<u32> bid_sizes;
+        std::vector<f32> ask_prices;
+        std::vector<u32> ask_sizes;
+    };
+
+    void submit_block();
+    bool reclaim_block();
+    void writer_loop();
+    void write_block(const Block& block);
+
+    SnapshotConfig config;
+    std::FILE* file;
+
+    std::vector<std::unique_ptr<Block>> blocks;
+    Block* current;
+
+    // guarded by mutex, full is a fixed ring since a block is only ever in one place
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable drained;
+    std::vector<Block*> free_blocks;
+    std::vector<Block*> full_blocks;
+    size_t full_head;
+    size_t full_count;
+    bool stopping;
+
+    u64 rows_written; // writer thread only
+    u64 dropped_rows; // producer only
+    int write_error;  // writer thread only, errno of the first failed write
+
+    std::vector<std::byte> encode_buffer; // writer thread only
+    std::thread writer;
+};
+
+// Read side, mmaps a snapshot file and exposes each block's columns in place
+class SnapshotReader {
+public:
+    struct BlockView {
+        const SnapshotBlockHeader* header;
+        u32 depth;
+        const void* timestamps;
+        const u16*  locates;
+        const u8*   reasons;
+        const f32*  bid_prices;
+        const u32*  bid_sizes;
+        const f32*  ask_prices;
+        const u32*  ask_sizes;
+
+        u32 rows() const { return header->rows; }
+        u64 timestamp(u32 row) const;
+        f32 bid_price(u32 level, u32 row) const { return bid_prices[level * header->rows + row]; }
+        u32 bid_size(u32 level, u32 row) const  { return bid_sizes[level * header->rows + row]; }
+        f32 ask_price(u32 level, u32 row) const { return ask_prices[level * header->rows + row]; }
+        u32 ask_size(u32 level, u32 row) const  { return ask_sizes[level * header->rows + row]; }
+    };
+
+    explicit SnapshotReader(const std::string& path);
+    ~SnapshotReader();
+
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    u32 get_depth() const { return header->depth; }
+    const std::vector<BlockView>& get_blocks() const { return blocks; }
+
+private:
+    const std::byte* data;
+    size_t size;
+    const SnapshotFileHeader* header;
+    std::vector<BlockView> blocks;
+};
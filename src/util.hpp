@@ -2,6 +2,9 @@
 
 #include <cstdint>
 #include <chrono>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
 
 template<class ...Ts> 
 struct overloaded : Ts... { 
@@ -296,6 +299,19 @@ constexpr size_t get_message_size(char c) {
     }
 }
 
+template<typename T>
+constexpr char get_message_code() {
+#define X(code, type) if constexpr (std::is_same_v<T, type>) return code; else
+    MESSAGE_LIST
+#undef X
+    return 0;
+}
+
+// ITCH stock fields are a fixed 8 chars with no room for a terminator
+inline std::string_view stock_view(const char (&stock)[8]) {
+    return std::string_view(stock, strnlen(stock, sizeof(stock)));
+}
+
 inline u64 get_ns_from_midnight() {
     using namespace std::chrono;
     auto now              = system_clock::now();